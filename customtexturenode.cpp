@@ -15,6 +15,9 @@ CustomTextureNode::CustomTextureNode( QQuickItem* item )
 
     m_window = m_item->window();
 
+    // The render target may be smaller than the item when dynamic resolution kicks in.
+    setFiltering( QSGTexture::Linear );
+
     connect( m_window, &QQuickWindow::beforeRendering, this, &CustomTextureNode::render );
 
     connect( m_window, &QQuickWindow::screenChanged, this, [this]() {
@@ -36,9 +39,11 @@ CustomTextureNode::~CustomTextureNode() {
     m_dev.destroyRenderPass( m_renderPass );
     m_dev.destroyDescriptorSetLayout( m_resLayout );
     m_dev.destroyDescriptorPool( m_descriptorPool );
+    m_dev.destroyQueryPool( m_timestampPool );
 
     delete texture();
     freeTexture();
+    releaseRetiredTextures( true );
 }
 
 QSGTexture* CustomTextureNode::texture() const {
@@ -55,6 +60,13 @@ const std::vector<float> vertices {
 // clang-format on
 const int UBUF_SIZE = 4;
 
+// Dynamic resolution tuning. The measured GPU time is smoothed, and the scale only
+// moves one step after it has stayed outside the hysteresis band for a number of frames.
+const qreal RESOLUTION_SCALE_STEP = 0.1;
+const qreal GPU_TIME_HYSTERESIS = 0.15;
+const int HYSTERESIS_FRAMES = 30;
+const qreal GPU_TIME_SMOOTHING = 0.1;
+
 bool CustomTextureNode::buildTexture( const QSize& size ) {
 
     vk::ImageCreateInfo imageInfo( vk::ImageCreateInfo(
@@ -141,6 +153,38 @@ void CustomTextureNode::freeTexture() {
     }
 }
 
+void CustomTextureNode::retireTexture() {
+    if ( !m_texture ) {
+        return;
+    }
+
+    // Frames still in flight may render into or sample from the old image, keep it alive until they are done.
+    const int framesInFlight = m_window->graphicsStateInfo().framesInFlight;
+    m_retiredTextures.push_back( { m_texture, m_textureView, m_textureFramebuffer, m_textureMemory, framesInFlight } );
+
+    m_texture = nullptr;
+    m_textureView = nullptr;
+    m_textureFramebuffer = nullptr;
+    m_textureMemory = nullptr;
+}
+
+void CustomTextureNode::releaseRetiredTextures( bool force ) {
+    auto it = m_retiredTextures.begin();
+
+    while ( it != m_retiredTextures.end() ) {
+        if ( !force && --it->framesLeft > 0 ) {
+            ++it;
+            continue;
+        }
+
+        m_dev.destroyFramebuffer( it->framebuffer );
+        m_dev.freeMemory( it->memory );
+        m_dev.destroyImageView( it->view );
+        m_dev.destroyImage( it->image );
+        it = m_retiredTextures.erase( it );
+    }
+}
+
 static inline VkDeviceSize aligned( VkDeviceSize v, VkDeviceSize byteAlign ) {
     return ( v + byteAlign - 1 ) & ~( byteAlign - 1 );
 }
@@ -248,6 +292,8 @@ bool CustomTextureNode::initialize() {
     } catch ( vk::SystemError err ) { qFatal( "Failed to bind vertex buffer memory: %s", err.what() ); }
 
     m_allocPerUbuf = aligned( UBUF_SIZE, physDevProps.limits.minUniformBufferOffsetAlignment );
+    m_maxImageDimension = physDevProps.limits.maxImageDimension2D;
+    m_timestampPeriod = physDevProps.limits.timestampPeriod;
 
     bufferInfo.size = framesInFlight * m_allocPerUbuf;
     bufferInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
@@ -442,9 +488,168 @@ bool CustomTextureNode::initialize() {
     writeInfo.pBufferInfo = &bufInfo;
 
     m_dev.updateDescriptorSets( 1, &writeInfo, 0, nullptr );
+
+    m_timestampsAvailable = createTimestampQueries( physDevProps.limits );
+
+    return true;
+}
+
+bool CustomTextureNode::createTimestampQueries( const vk::PhysicalDeviceLimits& limits ) {
+    if ( !limits.timestampComputeAndGraphics ) {
+        qWarning() << "Timestamp queries not supported, dynamic resolution disabled";
+        return false;
+    }
+
+    // Qt does not expose which queue family it renders on, so take the narrowest
+    // timestamp counter among the graphics capable families.
+    uint32_t validBits = 64;
+
+    for ( const vk::QueueFamilyProperties& family : m_physDev.getQueueFamilyProperties() ) {
+        if ( family.queueFlags & vk::QueueFlagBits::eGraphics ) {
+            validBits = qMin( validBits, family.timestampValidBits );
+        }
+    }
+
+    if ( validBits == 0 ) {
+        qWarning() << "Graphics queue has no valid timestamp bits, dynamic resolution disabled";
+        return false;
+    }
+
+    m_timestampMask = validBits < 64 ? ( uint64_t( 1 ) << validBits ) - 1 : ~uint64_t( 0 );
+
+    const int framesInFlight = m_window->graphicsStateInfo().framesInFlight;
+
+    // Two timestamps (begin, end) per frame slot.
+    vk::QueryPoolCreateInfo queryPoolInfo( vk::QueryPoolCreateFlags {}, vk::QueryType::eTimestamp, uint32_t( 2 * framesInFlight ) );
+
+    try {
+        m_timestampPool = m_dev.createQueryPool( queryPoolInfo );
+    } catch ( vk::SystemError err ) {
+        qWarning() << "Failed to create timestamp query pool: " << err.what();
+        return false;
+    }
+
+    m_timestampPending.assign( framesInFlight, false );
+    m_timestampScale.assign( framesInFlight, 0.0 );
+
     return true;
 }
 
+void CustomTextureNode::readTimestampQueries( uint frameSlot ) {
+    if ( !m_timestampPending[frameSlot] ) {
+        return;
+    }
+
+    m_timestampPending[frameSlot] = false;
+
+    // The frame that last used this slot has completed by now, so do not wait on the results.
+    std::array<uint64_t, 2> timestamps {};
+    const vk::Result result = m_dev.getQueryPoolResults( m_timestampPool, 2 * frameSlot, 2, sizeof( timestamps ), timestamps.data(),
+                                                         sizeof( uint64_t ), vk::QueryResultFlagBits::e64 );
+
+    if ( result != vk::Result::eSuccess ) {
+        return;
+    }
+
+    // Frames recorded before the last scale change reached sync() do not describe the current resolution.
+    if ( !qFuzzyCompare( m_timestampScale[frameSlot], m_resolutionScale ) ) {
+        return;
+    }
+
+    const uint64_t ticks = ( timestamps[1] - timestamps[0] ) & m_timestampMask;
+    updateResolutionScale( qreal( ticks ) * m_timestampPeriod / 1.0e6 );
+}
+
+void CustomTextureNode::updateResolutionScale( qreal gpuTimeMs ) {
+    m_gpuTime = m_gpuTime > 0.0 ? m_gpuTime + GPU_TIME_SMOOTHING * ( gpuTimeMs - m_gpuTime ) : gpuTimeMs;
+
+    if ( !m_dynamicResolution ) {
+        return;
+    }
+
+    const qreal upperBound = m_targetGpuTime * ( 1.0 + GPU_TIME_HYSTERESIS );
+    const qreal lowerBound = m_targetGpuTime * ( 1.0 - GPU_TIME_HYSTERESIS );
+
+    if ( m_gpuTime > upperBound ) {
+        ++m_framesOverBudget;
+        m_framesUnderBudget = 0;
+    } else if ( m_gpuTime < lowerBound ) {
+        ++m_framesUnderBudget;
+        m_framesOverBudget = 0;
+    } else {
+        m_framesOverBudget = 0;
+        m_framesUnderBudget = 0;
+    }
+
+    qreal newScale = m_resolutionScale;
+
+    if ( m_framesOverBudget >= HYSTERESIS_FRAMES ) {
+        newScale = qMax( m_minResolutionScale, m_resolutionScale - RESOLUTION_SCALE_STEP );
+    } else if ( m_framesUnderBudget >= HYSTERESIS_FRAMES ) {
+        const qreal candidate = qMin( m_maxResolutionScale, m_resolutionScale + RESOLUTION_SCALE_STEP );
+        const qreal ratio = candidate / m_resolutionScale;
+
+        // The pixel count grows with the square of the scale. Do not step up into the
+        // over budget band, or the scale would keep bouncing between two steps.
+        if ( m_gpuTime * ratio * ratio < upperBound ) {
+            newScale = candidate;
+        } else {
+            m_framesUnderBudget = 0;
+        }
+    }
+
+    if ( qFuzzyCompare( newScale, m_resolutionScale ) ) {
+        return;
+    }
+
+    m_resolutionScale = newScale;
+    m_framesOverBudget = 0;
+    m_framesUnderBudget = 0;
+    // Measure the new resolution from scratch; old size samples are dropped in readTimestampQueries().
+    m_gpuTime = 0.0;
+
+    // render() runs on the render thread, the item has to be updated on its own thread.
+    QQuickItem* item = m_item;
+    QMetaObject::invokeMethod( item, [item]() { item->update(); }, Qt::QueuedConnection );
+}
+
+void CustomTextureNode::setDynamicResolution( bool enabled ) {
+    if ( m_dynamicResolution == enabled ) {
+        return;
+    }
+
+    m_dynamicResolution = enabled;
+    m_framesOverBudget = 0;
+    m_framesUnderBudget = 0;
+    m_gpuTime = 0.0;
+    m_timestampPending.assign( m_timestampPending.size(), false );
+
+    m_resolutionScale = enabled ? qBound( m_minResolutionScale, m_resolutionScale, m_maxResolutionScale ) : 1.0;
+}
+
+void CustomTextureNode::setResolutionScaleBounds( qreal minScale, qreal maxScale ) {
+    m_minResolutionScale = qMax( RESOLUTION_SCALE_STEP, minScale );
+    m_maxResolutionScale = qMax( m_minResolutionScale, maxScale );
+    m_resolutionScale = qBound( m_minResolutionScale, m_resolutionScale, m_maxResolutionScale );
+}
+
+void CustomTextureNode::setTargetGpuTime( qreal milliseconds ) {
+    if ( milliseconds <= 0.0 ) {
+        qWarning() << "Ignoring non-positive target GPU time: " << milliseconds;
+        return;
+    }
+
+    m_targetGpuTime = milliseconds;
+}
+
+qreal CustomTextureNode::resolutionScale() const {
+    return dynamicResolutionActive() ? m_resolutionScale : 1.0;
+}
+
+bool CustomTextureNode::dynamicResolutionActive() const {
+    return m_dynamicResolution && m_timestampsAvailable;
+}
+
 void CustomTextureNode::sync() {
 
     if ( !m_initialized ) {
@@ -461,7 +666,13 @@ void CustomTextureNode::sync() {
     }
 
     m_device_pixel_ratio = m_window->effectiveDevicePixelRatio();
-    const QSize newSize = m_window->size() * m_device_pixel_ratio;
+    const QSizeF fullSize = QSizeF( m_window->size() ) * m_device_pixel_ratio;
+    const QSize maxSize( int( m_maxImageDimension ), int( m_maxImageDimension ) );
+
+    // With dynamic resolution the target is allocated once at the largest scale and
+    // only a sub-rect of it is rendered, so scale changes never reallocate it.
+    const qreal allocationScale = dynamicResolutionActive() ? m_maxResolutionScale : 1.0;
+    const QSize newSize = ( fullSize * allocationScale ).toSize().expandedTo( QSize( 1, 1 ) ).boundedTo( maxSize );
 
     if ( newSize != m_size ) {
         needsNew = true;
@@ -470,13 +681,17 @@ void CustomTextureNode::sync() {
 
     if ( needsNew ) {
         delete texture();
-        freeTexture();
+        retireTexture();
         buildTexture( m_size );
         QSGTexture* wrapper = QNativeInterface::QSGVulkanTexture::fromNative( m_texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, m_window, m_size );
         setTexture( wrapper );
         //        Q_ASSERT( wrapper->nativeInterface<QNativeInterface::QSGVulkanTexture>()->nativeImage() == m_texture );
     }
 
+    m_renderScale = resolutionScale();
+    m_renderSize = ( fullSize * m_renderScale ).toSize().expandedTo( QSize( 1, 1 ) ).boundedTo( m_size );
+    setSourceRect( QRectF( QPointF( 0, 0 ), QSizeF( m_renderSize ) ) );
+
     //    m_t = float( static_cast<CustomTextureItem*>( m_item )->t() );
 
     m_t = ( ( ( int )( m_t * 100 ) % 100 ) + 1 ) / 100.0;
@@ -489,6 +704,8 @@ void CustomTextureNode::render() {
 
     const uint currentFrameSlot = m_window->graphicsStateInfo().currentFrameSlot;
 
+    releaseRetiredTextures( false );
+
     vk::DeviceSize ubufOffset( currentFrameSlot * m_allocPerUbuf );
 
     try {
@@ -501,11 +718,18 @@ void CustomTextureNode::render() {
     const std::array<float, 4> backgroundColor { 0.0f, 0.0f, 0.0f, 1.0f };
     vk::ClearValue clearColor( backgroundColor );
 
-    vk::RenderPassBeginInfo rpBeginInfo( m_renderPass, m_textureFramebuffer, vk::Rect2D { m_size.width(), m_size.height() }, clearColor, nullptr );
+    const vk::Rect2D renderArea { { 0, 0 }, { static_cast<uint32_t>( m_renderSize.width() ), static_cast<uint32_t>( m_renderSize.height() ) } };
+    vk::RenderPassBeginInfo rpBeginInfo( m_renderPass, m_textureFramebuffer, renderArea, clearColor, nullptr );
 
     QSGRendererInterface* rif = m_window->rendererInterface();
     vk::CommandBuffer cmdBuf = *reinterpret_cast<vk::CommandBuffer*>( rif->getResource( m_window, QSGRendererInterface::CommandListResource ) );
 
+    if ( m_timestampPool && m_dynamicResolution ) {
+        readTimestampQueries( currentFrameSlot );
+        cmdBuf.resetQueryPool( m_timestampPool, 2 * currentFrameSlot, 2 );
+        cmdBuf.writeTimestamp( vk::PipelineStageFlagBits::eTopOfPipe, m_timestampPool, 2 * currentFrameSlot );
+    }
+
     cmdBuf.beginRenderPass( rpBeginInfo, vk::SubpassContents::eInline );
 
     cmdBuf.bindPipeline( vk::PipelineBindPoint::eGraphics, m_pipeline );
@@ -517,11 +741,10 @@ void CustomTextureNode::render() {
 
     cmdBuf.bindDescriptorSets( vk::PipelineBindPoint::eGraphics, m_pipelineLayout, 0, m_ubufDescriptor, dynamicOffset );
 
-    vk::Viewport viewport { 0, 0, static_cast<float>( m_size.width() ), static_cast<float>( m_size.height() ), 0.0f, 1.0f };
+    vk::Viewport viewport { 0, 0, static_cast<float>( m_renderSize.width() ), static_cast<float>( m_renderSize.height() ), 0.0f, 1.0f };
     cmdBuf.setViewport( 0, viewport );
 
-    vk::Rect2D scissor = { { 0, 0 }, { static_cast<uint32_t>( m_size.width() ), static_cast<uint32_t>( m_size.height() ) } };
-    cmdBuf.setScissor( 0, scissor );
+    cmdBuf.setScissor( 0, renderArea );
 
     cmdBuf.draw( 4, 1, 0, 0 );
     cmdBuf.endRenderPass();
@@ -534,6 +757,12 @@ void CustomTextureNode::render() {
     cmdBuf.pipelineBarrier( vk::PipelineStageFlags { vk::PipelineStageFlagBits::eColorAttachmentOutput },
                             vk::PipelineStageFlags { vk::PipelineStageFlagBits::eFragmentShader }, vk::DependencyFlags {}, 0, nullptr, 0, nullptr, 1,
                             &imageTransitionBarrier );
+
+    if ( m_timestampPool && m_dynamicResolution ) {
+        cmdBuf.writeTimestamp( vk::PipelineStageFlagBits::eBottomOfPipe, m_timestampPool, 2 * currentFrameSlot + 1 );
+        m_timestampPending[currentFrameSlot] = true;
+        m_timestampScale[currentFrameSlot] = m_renderScale;
+    }
 }
 
 void CustomTextureNode::prepareShader( Stage stage ) {
@@ -21,20 +21,48 @@ public:
 
     void sync();
 
+    // Dynamic resolution: the rendered area is scaled between the given bounds so that
+    // the GPU time of this node's own render pass approaches the target GPU time. This is
+    // not the whole frame time, only what render() costs on the GPU.
+    // The owning item is expected to call these from updatePaintNode(), before sync().
+    // Without timestamp query support the mode stays inactive and the scale is 1.0.
+    void setDynamicResolution( bool enabled );
+    void setResolutionScaleBounds( qreal minScale, qreal maxScale );
+    void setTargetGpuTime( qreal milliseconds );
+    qreal resolutionScale() const;
+
 private slots:
     void render();
 
 private:
     enum Stage { VertexStage, FragmentStage };
+
+    // A render target that may still be referenced by frames in flight.
+    struct RetiredTexture {
+        vk::Image image;
+        vk::ImageView view;
+        vk::Framebuffer framebuffer;
+        vk::DeviceMemory memory;
+        int framesLeft;
+    };
+
     void prepareShader( Stage stage );
     bool buildTexture( const QSize& size );
     void freeTexture();
+    void retireTexture();
+    void releaseRetiredTextures( bool force );
     bool createRenderPass();
     bool initialize();
+    bool createTimestampQueries( const vk::PhysicalDeviceLimits& limits );
+    void readTimestampQueries( uint frameSlot );
+    void updateResolutionScale( qreal gpuTimeMs );
+    bool dynamicResolutionActive() const;
 
     QQuickItem* m_item;
     QQuickWindow* m_window;
     QSize m_size;
+    QSize m_renderSize;
+    qreal m_renderScale = 1.0;
     qreal m_device_pixel_ratio;
 
     std::vector<char> m_vert;
@@ -44,6 +72,7 @@ private:
     vk::DeviceMemory m_textureMemory = { nullptr };
     vk::Framebuffer m_textureFramebuffer = { nullptr };
     vk::ImageView m_textureView = { nullptr };
+    std::vector<RetiredTexture> m_retiredTextures;
 
     bool m_initialized = false;
 
@@ -71,4 +100,21 @@ private:
     std::vector<vk::DescriptorSet> m_ubufDescriptor = { nullptr };
 
     vk::RenderPass m_renderPass = { nullptr };
+
+    vk::QueryPool m_timestampPool = { nullptr };
+    std::vector<bool> m_timestampPending;
+    std::vector<qreal> m_timestampScale;
+    float m_timestampPeriod = 1.0f;
+    uint64_t m_timestampMask = ~uint64_t( 0 );
+    bool m_timestampsAvailable = false;
+    uint32_t m_maxImageDimension = 0;
+
+    bool m_dynamicResolution = false;
+    qreal m_resolutionScale = 1.0;
+    qreal m_minResolutionScale = 0.5;
+    qreal m_maxResolutionScale = 1.0;
+    qreal m_targetGpuTime = 4.0;
+    qreal m_gpuTime = 0.0;
+    int m_framesOverBudget = 0;
+    int m_framesUnderBudget = 0;
 };